@@ -1,12 +1,74 @@
 // Took some code from the tone4 example and added the other necessary things
 // Plays Joy to the World and the Chocobo theme song from the game series Final Fantasy
 // Toggled on and off with a button
+//
+// Setting DDS_MODE to 1 replaces the square wave with direct digital synthesis:
+// Timer1_A runs at SAMPLE_RATE_KHZ and its CCR0 interrupt steps a 16 bit phase
+// accumulator through a 256 entry sine table, writing each sample into the
+// TA1CCR1 PWM duty cycle (output TA1.1 on P2.1, needs an RC low pass filter).
+// MCLK is raised to 8MHz in this mode, so the WDT runs at source/32K and
+// TEMPO_MULT keeps the note durations the same as in the 1MHz square wave mode.
+//
+// Cycle budget for dds_handler (8MHz, 16kHz => 500 cycles per sample).
+// These are ESTIMATES from the MSP430 instruction timings, not a compiler listing;
+// build with DDS_PROFILE set to measure them on the board.
+//												TA1R after
+//	interrupt accept					 6			 6
+//	push r15							 3			 9
+//	mov &ddsNext,&TA1CCR1				 6			15	<- CCR1 store
+//	mov &ddsInc,r15 / add r15,&ddsPhase	 7
+//	mov &ddsPhase,r15 / swpb / and / rla 7
+//	mov sineTable(r15),&ddsNext			 6
+//	pop r15 / reti						 7
+//	total								~42			(about 8% of the CPU)
+// Worst case extra latency from WDT_interval_handler, which sets GIE again
+// before doing any work so dds_handler can preempt its (software) float math:
+//	interrupt accept					 6
+//	push r12-r15						12
+//	bis #GIE,SR							 1
+//	total								~19, so the CCR1 store lands by TA1R ~34
+//										and the handler ends by ~61 of 500
+// Timer_A has no shadow register for CCR1: if the store lands after TA1R has
+// passed the new duty (but not the old one) the reset never fires and the output
+// stays high for the whole period. So the next sample is computed one tick ahead
+// and stored first, and sineTable never goes below DDS_MIN_DUTY (64), well above
+// the worst case store time of ~34.
+// Set DDS_PROFILE to 1 to record the worst cases measured on the board in
+// ddsMaxWriteCycles (TA1R just after the CCR1 store) and ddsMaxCycles (TA1R at
+// the end of the handler), and to count samples that ran into the next tick in
+// ddsMissedTicks.
 //-----------------------
 #include "msp430g2553.h"
 //-----------------------
 // define the bit mask (within P1) corresponding to output TA0
 #define TA0_BIT 0x02
 
+// DDS (wavetable) synthesis mode: 0 = square wave on TA0, 1 = sine on TA1.1 PWM
+#define DDS_MODE 0
+#define DDS_PROFILE 0
+
+#define TA1_1_BIT 0x02		// P2.1 = TA1.1 PWM output in DDS mode
+#define SAMPLE_RATE_KHZ 16
+#define SAMPLE_PERIOD (8000/SAMPLE_RATE_KHZ)	// SMCLK counts per sample at 8MHz
+#define DDS_MIN_DUTY 64		// lowest sineTable entry, must stay above the CCR1 store time
+#if DDS_MODE
+#if 8000 % SAMPLE_RATE_KHZ != 0
+#error "SAMPLE_RATE_KHZ must divide 8000 or DDS_INC_NUM gives the wrong pitch"
+#endif
+#if SAMPLE_PERIOD != 500
+#error "sineTable is scaled for SAMPLE_PERIOD == 500 (SAMPLE_RATE_KHZ 16)"
+#endif
+#endif
+// the tones[] half periods are in 1MHz counts, so f = 1000000/(2*halfPeriod)
+// and the phase increment f*65536/SAMPLE_RATE reduces to DDS_INC_NUM/halfPeriod
+#define DDS_INC_NUM (32768UL*1000/SAMPLE_RATE_KHZ)
+
+#if DDS_MODE
+#define TEMPO_MULT 2		// WDT ticks twice as often at 8MHz/32K
+#else
+#define TEMPO_MULT 1
+#endif
+
 // define the port and location for the button (this is the built in button)
 // specific bit for the button
 
@@ -48,9 +110,41 @@ const int chocoboIndex[] = {13,11,7,4,13,11,7, 11,7,11,9, 7,7,9,7,5,7,5,
 		13,17,13,11, 12,9,6,2,6,9,12, 11,11,12,11,9,11, 14,12,9,6,9,12,14,
 		13,17,13,11, 9,9,11,9,7,9,7, 9,9,11,12,13,14,16, 17};
 
+#if DDS_MODE
+// One period of a sine wave, 250 +/- 186, so every duty lies in [DDS_MIN_DUTY, SAMPLE_PERIOD-DDS_MIN_DUTY]
+const unsigned sineTable[256] = {
+	250,255,259,264,268,273,277,282,286,291,295,300,304,308,313,317,
+	321,325,330,334,338,342,346,350,353,357,361,364,368,371,375,378,
+	382,385,388,391,394,397,399,402,405,407,410,412,414,416,418,420,
+	422,424,425,427,428,429,430,431,432,433,434,435,435,435,436,436,
+	436,436,436,435,435,435,434,433,432,431,430,429,428,427,425,424,
+	422,420,418,416,414,412,410,407,405,402,399,397,394,391,388,385,
+	382,378,375,371,368,364,361,357,353,350,346,342,338,334,330,325,
+	321,317,313,308,304,300,295,291,286,282,277,273,268,264,259,255,
+	250,245,241,236,232,227,223,218,214,209,205,200,196,192,187,183,
+	179,175,170,166,162,158,154,150,147,143,139,136,132,129,125,122,
+	118,115,112,109,106,103,101,98,95,93,90,88,86,84,82,80,
+	78,76,75,73,72,71,70,69,68,67,66,65,65,65,64,64,
+	64,64,64,65,65,65,66,67,68,69,70,71,72,73,75,76,
+	78,80,82,84,86,88,90,93,95,98,101,103,106,109,112,115,
+	118,122,125,129,132,136,139,143,147,150,154,158,162,166,170,175,
+	179,183,187,192,196,200,205,209,214,218,223,227,232,236,241,245
+};
+
+unsigned ddsIncs[sizeof(tones)/2];	// phase increment for each entry of tones[]
+volatile unsigned ddsPhase = 0;		// phase accumulator, top 8 bits index sineTable
+volatile unsigned ddsNext = SAMPLE_PERIOD/2; // duty for the next sample tick
+volatile unsigned ddsInc = 0;		// phase increment being played (0 while silent)
+volatile unsigned ddsNoteInc = 0;	// phase increment of the current note
+volatile unsigned ddsMaxWriteCycles = 0; // worst case CCR1 store time (DDS_PROFILE)
+volatile unsigned ddsMaxCycles = 0;	// worst case handler time (DDS_PROFILE)
+volatile unsigned ddsMissedTicks = 0; // samples that overran their period (DDS_PROFILE)
+#endif
+
 int indexTones = 0;		//index for which tone to choose out of the tones array
 int indexDur = 0;		//index for choosing which duration out of the songs' arrays
 unsigned int tempo = 0;		//this isn't the tempo, it's really just the count until next note
+unsigned int noteTicks = 0;	//duration of the current note in WDT ticks (tempo counts up to it)
 unsigned int scoreNum = 1;		//Choose which score to play: 1 for Joy, 2 for Chocobo
 
 volatile unsigned char SP_last_button;		//Saves last state for each button
@@ -66,6 +160,13 @@ volatile unsigned pauseOn=0;	//for pauses between notes
 
 void init_timer(void); // routine to setup the timer
 void init_button(void); // routine to setup the buttons
+#if DDS_MODE
+void init_dds_incs(void); // precompute the phase increment of each tone
+void init_dds(void); // routine to setup the DDS sample timer
+#endif
+void set_tone(int i); // select tones[i] as the current note
+void set_duration(void); // work out noteTicks for the current note
+void advance_score(void); // move through the score as tempo counts up
 
 // ++++++++++++++++++++++++++
 void main(){
@@ -78,16 +179,31 @@ void main(){
 			   WDTTMSEL + // (bit 4) select interval timer mode
 			   WDTCNTCL +  // (bit 3) clear watchdog timer counter
 					  0 // bit 2=0 => SMCLK is the source
+#if DDS_MODE
+					  +0 // bits 1-0 = 00 => source/32K
+#else
 					  +1 // bits 1-0 = 01 => source/8K
+#endif
 			   );
 	IE1 |= WDTIE;		// enable the WDT interrupt (in the system interrupt register IE1)
 
+#if DDS_MODE
+	BCSCTL1 = CALBC1_8MHZ; // 8Mhz calibration for clock
+	DCOCTL = CALDCO_8MHZ;
+	init_dds_incs(); // set_tone needs the increments
+#else
 	BCSCTL1 = CALBC1_1MHZ; // 1Mhz calibration for clock
 	DCOCTL = CALDCO_1MHZ;
+#endif
 
-	halfPeriod = tones[joyIndex[indexTones]];
+	set_tone(joyIndex[indexTones]);
+	set_duration();
 	//halfPeriod=maxHP; // initial half-period at lowest frequency
+#if DDS_MODE
+	init_dds(); // start the sample timer
+#else
 	init_timer(); // initialize timer
+#endif
 	init_button(); // initialize the button
 	_bis_SR_register(GIE+LPM0_bits);// enable general interrupts and power down CPU
 }
@@ -104,13 +220,83 @@ void init_timer(){ // initialization and start of timer
 	P1DIR|=TA0_BIT;
 }
 
+#if DDS_MODE
+// +++++++++++++++++++++++++++
+// DDS Sound Production System
+// Timer1_A in up mode at SAMPLE_RATE_KHZ; CCR1 in reset/set mode is the PWM output
+// and CCR0 requests the next sample. While silent the phase is held at 0, which
+// keeps the output at the sine's midpoint instead of stepping down to 0.
+void init_dds_incs(){
+	unsigned i;
+	for (i=0; i<sizeof(tones)/2; i++)	// one 32 bit divide per note, done once
+		ddsIncs[i] = (DDS_INC_NUM + tones[i]/2) / tones[i];
+}
+
+void init_dds(){
+	TA1CTL |= TACLR; // reset clock
+	TA1CTL = TASSEL_2+ID_0+MC_1; // clock source = SMCLK, clock divider=1, up mode
+	TA1CCR0 = SAMPLE_PERIOD-1; // one interrupt per sample
+	TA1CCR1 = SAMPLE_PERIOD/2; // start at the midpoint
+	TA1CCTL1 = OUTMOD_7; // reset/set PWM
+	TA1CCTL0 = CCIE; // sample interrupt on
+	P2SEL |= TA1_1_BIT; // connect TA1.1 to the pin
+	P2DIR |= TA1_1_BIT;
+}
+
+// Sample handler: kept to a few dozen cycles, see the budget at the top of the file
+void interrupt dds_handler(){
+#if DDS_PROFILE
+	unsigned writeCycles;
+#endif
+	TA1CCR1 = ddsNext;	// store first, computed on the previous tick
+#if DDS_PROFILE
+	writeCycles = TA1R;
+	if (writeCycles > ddsMaxWriteCycles)
+		ddsMaxWriteCycles = writeCycles;
+#endif
+	ddsPhase += ddsInc;
+	ddsNext = sineTable[ddsPhase>>8];
+#if DDS_PROFILE
+	if (TA1R > ddsMaxCycles)
+		ddsMaxCycles = TA1R;
+	if (TA1CCTL0 & CCIFG) // next sample tick already came while we were late
+		++ddsMissedTicks;
+#endif
+}
+ISR_VECTOR(dds_handler,".int13") // TIMER1_A0 vector
+#endif
+
+// Select tones[i] as the current note for whichever output mode is in use
+void set_tone(int i){
+	halfPeriod = tones[i];
+#if DDS_MODE
+	ddsNoteInc = ddsIncs[i];
+#endif
+}
+
+// Work out the current note's duration once, so advance_score only does an integer compare
+void set_duration(){
+	float ticks = scale*2*TEMPO_MULT*(scoreNum == 1 ? joyTimes[indexDur] : chocoboTimes[indexDur]);
+	noteTicks = (unsigned)ticks;
+	if (noteTicks < ticks)	// round up so the note ends on the same tick as before
+		noteTicks++;
+}
+
 // +++++++++++++++++++++++++++
 void interrupt sound_handler(){
 	TA0CCR0 = halfPeriod-1;
+	advance_score();
+	TA0CCTL0 = CCIE + soundOn; //  update control register with current soundOn
+	++intcount; // advance debug counter
+}
+ISR_VECTOR(sound_handler,".int09") // declare interrupt vector
+
+// Move to the next note (and the pause before it) once its duration has passed
+void advance_score(){
 	// change half period if the sound is playing
-	if (soundOn && tempo>=(scoreNum == 1 ? scale*2*joyTimes[indexDur] : scale*2*chocoboTimes[indexDur])){
+	if (soundOn && tempo>=noteTicks){
 		indexTones++;		//increment tones index
-		halfPeriod = scoreNum == 1 ? tones[joyIndex[indexTones]] : tones[chocoboIndex[indexTones]];
+		set_tone(scoreNum == 1 ? joyIndex[indexTones] : chocoboIndex[indexTones]);
 		pauseOn = 1;
 		tempo=0;
 		indexDur++;			//increment duration index
@@ -132,15 +318,13 @@ void interrupt sound_handler(){
 				P1OUT ^= RED;
 			}
 		}
-	} else if (pauseOn!=0 && tempo>=5){
+		set_duration();		//duration of the next note
+	} else if (pauseOn!=0 && tempo>=5*TEMPO_MULT){
 		tempo = 0;
 		pauseOn = 0;
 		soundOn ^= OUTMOD_4;
 	}
-	TA0CCTL0 = CCIE + soundOn; //  update control register with current soundOn
-	++intcount; // advance debug counter
 }
-ISR_VECTOR(sound_handler,".int09") // declare interrupt vector
 
 // +++++++++++++++++++++++++++
 // Button input System
@@ -160,6 +344,9 @@ void interrupt WDT_interval_handler(){
   	unsigned char R_b;
   	unsigned char UP_b;
   	unsigned char DOWN_b;
+#if DDS_MODE
+  	_bis_SR_register(GIE); // let dds_handler preempt this handler (see cycle budget)
+#endif
   	SP_b= (P1IN & SP_BUTTON);  // read the BUTTON bit
   	R_b = (P1IN & R_BUTTON);
   	UP_b= (P1IN & UP_BUTTON);  // read the BUTTON bit
@@ -179,27 +366,41 @@ void interrupt WDT_interval_handler(){
 			indexTones = 0;
 			indexDur = 0;
 			scoreNum = 1;
-			halfPeriod = tones[joyIndex[indexTones]];
+			set_tone(joyIndex[indexTones]);
+			set_duration();
   		} else if (scoreNum==1&&tempo==0){		//Change to Chocobo if current song is Joy
   			scoreNum = 2;
-  			halfPeriod = tones[chocoboIndex[indexTones]];
+  			set_tone(chocoboIndex[indexTones]);
+  			set_duration();
   			P1OUT ^= GREEN;
   		} else if (scoreNum==2&&tempo==0){		//Change to Joy if current song is Chocobo
   			scoreNum = 1;
-  			halfPeriod = tones[joyIndex[indexTones]];
+  			set_tone(joyIndex[indexTones]);
+  			set_duration();
   			P1OUT ^= GREEN;
   		}
   	} else if (UP_last_button && (UP_b==0)){ // has the button bit gone from high to low
   		scale-=0.1;
   		if (scale<=0.1)
   			scale = 0.1;
+  		set_duration();
   	} else if (DOWN_last_button && (DOWN_b==0)){ // has the button bit gone from high to low
   		scale+=0.2;
   		if (scale>5)
   			scale = 5;
+  		set_duration();
   	}
   	if (soundOn || pauseOn)
   		tempo++;
+#if DDS_MODE
+  	advance_score(); // no TA0 interrupt in this mode, step the score here
+  	if (soundOn){
+  		ddsInc = ddsNoteInc;
+  	} else {	// hold the phase at 0 so the output rests at the midpoint
+  		ddsInc = 0;
+  		ddsPhase = 0;
+  	}
+#endif
   	SP_last_button=SP_b;    // remember button reading for next time.
   	R_last_button=R_b;    // remember button reading for next time.
   	UP_last_button=UP_b;    // remember button reading for next time.
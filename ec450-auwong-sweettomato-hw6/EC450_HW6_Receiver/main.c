@@ -11,6 +11,18 @@
  WDT divides SMCL by 512 (==> fastest rate gives 1 TX every 64 microseconds)
  Parameter ACTION_INTERVAL controls actual frequency of WDT interrupts that TX
  16 bit Parameter BIT_RATE_DIVISOR controls the SPI bitrate clock
+
+ Flow control.
+ Received bytes go into a small ring buffer (RX_BUF_SIZE) that sound_handler
+ drains one byte per timer interrupt. The RX_READY_BIT line on P2 is driven
+ high while there is room; it drops when the buffer reaches RX_HIGH_WATER
+ and comes back up once sound_handler drains it to RX_LOW_WATER. The master
+ only loads UCB0TXBUF while this line is high.
+ UCOE overruns and bytes that arrive to a full buffer are counted.
+ 3-pin slave SPI has no framing (UCFE is only used in 4-wire master mode), so
+ the only framing error counted is a stalled byte: still shifting in after a
+ whole WDT tick (two byte times) while the master should be sending. A bit slip
+ while streaming cannot be seen in this mode, and nothing realigns the link.
 */
 
 #include "msp430g2553.h"
@@ -24,9 +36,27 @@
 
 volatile unsigned char data_to_send = 0;	// current byte to transmit
 volatile unsigned long tx_count = 0;		// total number of transmissions
-volatile unsigned char data_received= 0; 	// most recent byte received
+volatile unsigned char data_received= 0; 	// most recent byte taken from rx_buf
 volatile unsigned long rx_count=0;			// total number received handler calls
 
+// RX ring buffer (size must be a power of 2, one slot is always left empty)
+#define RX_BUF_SIZE 16
+#define RX_BUF_MASK (RX_BUF_SIZE-1)
+#define RX_HIGH_WATER 12	// drop the ready line at this many bytes
+#define RX_LOW_WATER 4		// raise it again at this many bytes
+
+#define RX_READY_BIT 0x01	// P2.0 ready/backpressure line to the master
+
+volatile unsigned char rx_buf[RX_BUF_SIZE];	// bytes waiting for sound_handler
+volatile unsigned char rx_head=0;			// next slot written by spi_rx_handler
+volatile unsigned char rx_tail=0;			// next slot read by sound_handler
+volatile unsigned long overrun_count=0;		// UCOE: byte lost in the USCI itself
+volatile unsigned long framing_error_count=0; // stalled partial bytes seen by the WDT
+volatile unsigned long rx_count_last_tick=0; // rx_count at the previous WDT tick
+volatile unsigned char busy_last_tick=0;	// UCBUSY at the previous WDT tick
+volatile unsigned char stall_counted=0;		// current stall already in framing_error_count
+volatile unsigned long rx_dropped_count=0;	// byte arrived with rx_buf full
+
 volatile unsigned halfPeriod; // half period count for the timer
 volatile unsigned soundOn=OUTMOD_4; // state of sound: 0 or OUTMOD_4 (0x0080)
 
@@ -40,6 +70,18 @@ volatile unsigned soundOn=OUTMOD_4; // state of sound: 0 or OUTMOD_4 (0x0080)
 volatile unsigned int action_counter=ACTION_INTERVAL;
 
 interrupt void WDT_interval_handler(){
+	// Framing check: only while ready, since the master then sends every tick.
+	// Busy on two ticks in a row with no byte completed means a stalled byte,
+	// counted once until the next byte completes.
+	if (rx_count!=rx_count_last_tick){
+		stall_counted=0;
+	} else if ((UCB0STAT&UCBUSY) && busy_last_tick && !stall_counted
+			&& (P2OUT&RX_READY_BIT)){
+		++framing_error_count;
+		stall_counted=1;
+	}
+	busy_last_tick=UCB0STAT&UCBUSY;
+	rx_count_last_tick=rx_count;
 	if (--action_counter==0){
 		UCB0TXBUF=0x50; // init sending current byte
 		//++data_to_send; // increment byte to send for next time
@@ -69,7 +111,19 @@ void init_wdt(){
 // ======== Receive interrupt Handler for UCB0 ==========
 
 void interrupt spi_rx_handler(){
-	data_received=UCB0RXBUF; // copy data to global variable
+	unsigned char status=UCB0STAT;	// must be read before UCB0RXBUF clears UCOE
+	unsigned char next=(rx_head+1)&RX_BUF_MASK;
+	unsigned char data=UCB0RXBUF;	// reading RXBUF also clears UCOE
+	if (status&UCOE) ++overrun_count;
+	if (next==rx_tail){
+		++rx_dropped_count;			// buffer full, keep the older bytes
+	} else {
+		rx_buf[rx_head]=data;
+		rx_head=next;
+	}
+	if (((rx_head-rx_tail)&RX_BUF_MASK)>=RX_HIGH_WATER){
+		P2OUT &= ~RX_READY_BIT;		// tell the master to hold off
+	}
 	++rx_count;				 // increment the counter
 	IFG2 &= ~UCB0RXIFG;		 // clear UCB0 RX flag
 }
@@ -103,11 +157,23 @@ void init_spi(){
 	// Connect I/O pins to UCB0 SPI
 	P1SEL =SPI_CLK+SPI_SOMI+SPI_SIMO;
 	P1SEL2=SPI_CLK+SPI_SOMI+SPI_SIMO;
+	// Ready line back to the master, start out ready (buffer empty)
+	P2SEL &= ~RX_READY_BIT;
+	P2SEL2 &= ~RX_READY_BIT;
+	P2OUT |= RX_READY_BIT;
+	P2DIR |= RX_READY_BIT;
 }
 
 // +++++++++++++++++++++++++++
 void interrupt sound_handler(){
 	TA0CCR0 = halfPeriod-1;
+	if (rx_tail!=rx_head){ // take the next buffered byte, if any
+		data_received=rx_buf[rx_tail];
+		rx_tail=(rx_tail+1)&RX_BUF_MASK;
+		if (((rx_head-rx_tail)&RX_BUF_MASK)<=RX_LOW_WATER){
+			P2OUT |= RX_READY_BIT;	// room again, let the master resume
+		}
+	}
 	if (soundOn){ // change half period if the sound is playing
 		//halfPeriod = UCB0RXBUF; 			// adjust the period
 		if (/*data_received>=0xA0&&*/data_received<0xB0){
@@ -11,6 +11,12 @@
  WDT divides SMCL by 512 (==> fastest rate gives 1 TX every 64 microseconds)
  Parameter ACTION_INTERVAL controls actual frequency of WDT interrupts that TX
  16 bit Parameter BIT_RATE_DIVISOR controls the SPI bitrate clock
+
+ Flow control.
+ The receiver drives RX_READY_BIT (P2.0) high while its RX buffer has room.
+ A transmission is only started while that line is high; otherwise the slot
+ is skipped and counted in tx_paused_count. The input is pulled down so an
+ unconnected line pauses the link rather than dropping data.
  */
 
 #include "msp430g2553.h"
@@ -31,6 +37,9 @@ volatile unsigned char data_to_send = 0;	// current byte to transmit
 volatile unsigned long tx_count = 0;		// total number of transmissions
 volatile unsigned char data_received= 0; 	// most recent byte received
 volatile unsigned long rx_count=0;			// total number received handler calls
+volatile unsigned long tx_paused_count=0;	// slots skipped while receiver not ready
+
+#define RX_READY_BIT 0x01	// P2.0 ready/backpressure line from the receiver
 
 // Try for a fast send.  One transmission every 64 microseconds
 // bitrate = 1 bit every 4 microseconds
@@ -71,9 +80,13 @@ void init_adc(){
 interrupt void WDT_interval_handler(){
 	ADC10CTL0 |= ADC10SC; // trigger a conversion
 	if (--action_counter==0){
-		UCB0TXBUF=latest_result; // init sending current byte
-		//++data_to_send; // increment byte to send for next time
-		++tx_count;
+		if (P2IN&RX_READY_BIT){ // only send while the receiver has room
+			UCB0TXBUF=latest_result; // init sending current byte
+			//++data_to_send; // increment byte to send for next time
+			++tx_count;
+		} else {
+			++tx_paused_count;
+		}
 		action_counter=ACTION_INTERVAL;
 	}
 }
@@ -132,6 +145,12 @@ void init_spi(){
 	// Connect I/O pins to UCB0 SPI
 	P1SEL =SPI_CLK+SPI_SOMI+SPI_SIMO;
 	P1SEL2=SPI_CLK+SPI_SOMI+SPI_SIMO;
+	// Ready line from the receiver: input with pull-down
+	P2SEL &= ~RX_READY_BIT;
+	P2SEL2 &= ~RX_READY_BIT;
+	P2DIR &= ~RX_READY_BIT;
+	P2OUT &= ~RX_READY_BIT;				// pull-down
+	P2REN |= RX_READY_BIT;
 }
 
 